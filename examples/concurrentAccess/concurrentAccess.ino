@@ -0,0 +1,69 @@
+// Requires a platform with std::thread support (e.g. ESP32); it will not build on AVR-class targets
+#include <Arduino.h>
+#include <ConcurrentGEA3.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+static ConcurrentGEA3 gea3;
+
+// Serial is shared by several threads, so guard it like any other shared resource
+static std::mutex serialMutex;
+
+// Callbacks run on the I/O thread and must not block, so the subscription only records
+// the most recent change and loop() does the printing
+static constexpr uint32_t noChange = UINT32_MAX;
+static std::atomic<uint32_t> changedErd(noChange);
+
+template <typename... Args>
+static void printSerialized(const char* format, Args... args)
+{
+  std::lock_guard<std::mutex> lock(serialMutex);
+  Serial.printf(format, args...);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+
+  Serial1.begin(GEA3::baud);
+
+  gea3.begin(Serial1);
+
+  // Active for the lifetime of the sketch, so the handle is not kept; to stop it,
+  // call cancel() and wait on the returned future before releasing captured state
+  gea3.subscribe([](uint16_t erd, const void*, uint8_t) {
+    changedErd.store(erd);
+  });
+
+  std::thread reader([]() {
+    auto result = gea3.readERD<GEA3::U32>(0x0035).get();
+    if(result.status == GEA3::ReadStatus::success) {
+      printSerialized("Successfully read ERD 0x0035: 0x%08X\n", result.value.read());
+    }
+    else {
+      printSerialized("Failed to read ERD 0x0035\n");
+    }
+  });
+
+  std::thread writer([]() {
+    auto status = gea3.writeERD(0x0035, GEA3::U32(1234)).get();
+    if(status == GEA3::WriteStatus::success) {
+      printSerialized("Successfully wrote ERD 0x0035\n");
+    }
+    else {
+      printSerialized("Failed to write ERD 0x0035\n");
+    }
+  });
+
+  reader.join();
+  writer.join();
+}
+
+void loop()
+{
+  auto erd = changedErd.exchange(noChange);
+  if(erd != noChange) {
+    printSerialized("ERD 0x%04X changed\n", erd);
+  }
+}
@@ -0,0 +1,577 @@
+/*!
+ * @file
+ * @brief Thread-safe front end for GEA3. A dedicated I/O thread owns the GEA3
+ * instance and executes commands that other threads post to a lock-free
+ * multi-producer, single-consumer queue.
+ *
+ * Reads and writes complete through futures. When the ERD client's queue is
+ * full, further requests wait in the command queue until earlier ones finish.
+ * Subscription and packet callbacks are invoked on the I/O thread and must not
+ * block. Their callbacks may still run until the future returned by cancel() is
+ * ready, so wait on it before releasing anything they capture (but never from
+ * inside a callback).
+ *
+ * An instance is single-use: begin() may be called once and end() stops it for
+ * good. end() may be called from any number of threads; each call returns once
+ * every subscription has been released and every outstanding read, write and
+ * command has failed with std::future_errc::broken_promise. Called from a
+ * callback, end() only stops the I/O thread, and a later end() from another
+ * thread (or the destructor) completes the shutdown. The destructor itself
+ * must not run on the I/O thread.
+ */
+
+#ifndef ConcurrentGEA3_h
+#define ConcurrentGEA3_h
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "GEA3.h"
+
+class ConcurrentGEA3 {
+ private:
+  // Dmitry Vyukov's intrusive MPSC node-based queue:
+  // https://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+  class CommandQueue {
+   public:
+    struct Node {
+      Node()
+        : next(nullptr), execute()
+      {
+      }
+
+      Node(std::function<bool(GEA3& gea3)> execute)
+        : next(nullptr), execute(std::move(execute))
+      {
+      }
+
+      std::atomic<Node*> next;
+      // Returns false if the command must be retried on a later pass
+      std::function<bool(GEA3& gea3)> execute;
+    };
+
+    CommandQueue()
+      : head(&stub), tail(&stub), stub()
+    {
+    }
+
+    ~CommandQueue()
+    {
+      while(auto node = pop()) {
+        delete node;
+      }
+    }
+
+    // Safe to call from any number of threads concurrently
+    void push(Node* node)
+    {
+      node->next.store(nullptr, std::memory_order_relaxed);
+      auto previous = head.exchange(node, std::memory_order_acq_rel);
+      previous->next.store(node, std::memory_order_release);
+    }
+
+    // Must only be called by the consumer; returns nullptr when empty or when
+    // a producer has not finished linking its node yet
+    Node* pop()
+    {
+      auto tail = this->tail;
+      auto next = tail->next.load(std::memory_order_acquire);
+
+      if(tail == &stub) {
+        if(next == nullptr) {
+          return nullptr;
+        }
+        this->tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+
+      if(next != nullptr) {
+        this->tail = next;
+        return tail;
+      }
+
+      if(tail != head.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+
+      push(&stub);
+
+      next = tail->next.load(std::memory_order_acquire);
+      if(next != nullptr) {
+        this->tail = next;
+        return tail;
+      }
+
+      return nullptr;
+    }
+
+   private:
+    std::atomic<Node*> head;
+    Node* tail;
+    Node stub;
+  };
+
+  struct PrivateHost;
+
+  struct PrivateRequest {
+    PrivateRequest(PrivateHost* host)
+      : host(host), position()
+    {
+    }
+
+    virtual ~PrivateRequest()
+    {
+    }
+
+    PrivateHost* host;
+    std::list<std::unique_ptr<PrivateRequest>>::iterator position;
+  };
+
+  template <typename Result>
+  struct PrivatePromise : PrivateRequest {
+    PrivatePromise(PrivateHost* host, std::shared_ptr<std::promise<Result>> promise)
+      : PrivateRequest(host), promise(std::move(promise))
+    {
+    }
+
+    std::shared_ptr<std::promise<Result>> promise;
+  };
+
+  struct PrivateRegistration {
+    PrivateRegistration(uint32_t id)
+      : id(id)
+    {
+    }
+
+    virtual ~PrivateRegistration()
+    {
+    }
+
+    uint32_t id;
+  };
+
+  struct PrivatePacketListener : PrivateRegistration {
+    PrivatePacketListener(uint32_t id, std::function<void(const GEA3::Packet& packet)> callback)
+      : PrivateRegistration(id), callback(std::move(callback)), listener(nullptr, nullptr)
+    {
+    }
+
+    ~PrivatePacketListener()
+    {
+      listener.cancel();
+    }
+
+    std::function<void(const GEA3::Packet& packet)> callback;
+    GEA3::PacketListener listener;
+  };
+
+  struct PrivateErdSubscription : PrivateRegistration {
+    PrivateErdSubscription(uint32_t id, std::function<void(uint16_t erd, const void* value, uint8_t valueSize)> callback)
+      : PrivateRegistration(id), callback(std::move(callback)), subscription(nullptr)
+    {
+    }
+
+    ~PrivateErdSubscription()
+    {
+      subscription.cancel();
+    }
+
+    std::function<void(uint16_t erd, const void* value, uint8_t valueSize)> callback;
+    GEA3::ErdSubscription subscription;
+  };
+
+  // State shared by the facade, the I/O thread and outstanding handles. Apart
+  // from the queue and the atomics, it is only touched by the I/O thread.
+  struct PrivateHost {
+    static constexpr uint8_t commandsPerLoop = 16;
+
+    PrivateHost()
+      : queue(), running(false), finished(false), posters(0), nextId(0), ioThread(std::thread::id()), gea3(), deferred(nullptr), requests(), registrations()
+    {
+    }
+
+    bool post(std::function<bool(GEA3& gea3)> command)
+    {
+      posters++;
+      bool accepted = !finished.load();
+      if(accepted) {
+        queue.push(new CommandQueue::Node(std::move(command)));
+      }
+      posters--;
+      return accepted;
+    }
+
+    void run(uint32_t idleInterval)
+    {
+      while(running.load(std::memory_order_acquire)) {
+        uint8_t executed = 0;
+
+        // Bounded so that a steady stream of commands cannot starve the bus
+        while(executed < commandsPerLoop) {
+          auto node = (deferred != nullptr) ? deferred : queue.pop();
+          deferred = nullptr;
+          if(node == nullptr) {
+            break;
+          }
+          if(!node->execute(gea3)) {
+            deferred = node;
+            break;
+          }
+          delete node;
+          executed++;
+        }
+
+        gea3.loop();
+
+        if(executed == 0) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(idleInterval));
+        }
+      }
+
+      delete deferred;
+      deferred = nullptr;
+      registrations.clear();
+      requests.clear();
+    }
+
+    // Called once the I/O thread has stopped (or was never started), and never
+    // concurrently with itself
+    void finish()
+    {
+      finished.store(true);
+      while(posters.load() != 0) {
+        std::this_thread::yield();
+      }
+
+      while(auto node = queue.pop()) {
+        delete node;
+      }
+    }
+
+    template <typename Result>
+    PrivatePromise<Result>* track(std::shared_ptr<std::promise<Result>> promise)
+    {
+      auto request = new PrivatePromise<Result>(this, std::move(promise));
+      requests.emplace_back(request);
+      request->position = std::prev(requests.end());
+      return request;
+    }
+
+    void complete(PrivateRequest* request)
+    {
+      requests.erase(request->position);
+    }
+
+    void release(uint32_t id)
+    {
+      for(auto i = registrations.begin(); i != registrations.end(); i++) {
+        if((*i)->id == id) {
+          registrations.erase(i);
+          return;
+        }
+      }
+    }
+
+    CommandQueue queue;
+    std::atomic<bool> running;
+    std::atomic<bool> finished;
+    std::atomic<uint32_t> posters;
+    std::atomic<uint32_t> nextId;
+    std::atomic<std::thread::id> ioThread;
+    GEA3 gea3;
+    CommandQueue::Node* deferred;
+    std::list<std::unique_ptr<PrivateRequest>> requests;
+    std::list<std::shared_ptr<PrivateRegistration>> registrations;
+  };
+
+  static std::future<void> cancel(std::weak_ptr<PrivateHost>& weakHost, uint32_t id)
+  {
+    // Ready once the command that released the registration is gone, whether
+    // it ran or was discarded after the I/O thread had already released it
+    struct Acknowledgement {
+      ~Acknowledgement()
+      {
+        promise.set_value();
+      }
+
+      std::promise<void> promise;
+    };
+
+    auto acknowledgement = std::make_shared<Acknowledgement>();
+    auto future = acknowledgement->promise.get_future();
+
+    auto host = weakHost.lock();
+    weakHost.reset();
+
+    if(host != nullptr) {
+      auto rawHost = host.get();
+      host->post([rawHost, acknowledgement, id](GEA3&) {
+        rawHost->release(id);
+        return true;
+      });
+    }
+
+    return future;
+  }
+
+ public:
+  class PacketListener {
+   public:
+    PacketListener(std::weak_ptr<PrivateHost> host, uint32_t id)
+      : host(std::move(host)), id(id)
+    {
+    }
+
+    std::future<void> cancel()
+    {
+      return ConcurrentGEA3::cancel(host, id);
+    }
+
+   private:
+    std::weak_ptr<PrivateHost> host;
+    uint32_t id;
+  };
+
+  class ErdSubscription {
+   public:
+    ErdSubscription(std::weak_ptr<PrivateHost> host, uint32_t id)
+      : host(std::move(host)), id(id)
+    {
+    }
+
+    std::future<void> cancel()
+    {
+      return ConcurrentGEA3::cancel(host, id);
+    }
+
+   private:
+    std::weak_ptr<PrivateHost> host;
+    uint32_t id;
+  };
+
+  ConcurrentGEA3()
+    : host(std::make_shared<PrivateHost>()), lifecycleMutex(), started(false), thread()
+  {
+  }
+
+  ~ConcurrentGEA3()
+  {
+    end();
+  }
+
+  ConcurrentGEA3(const ConcurrentGEA3&) = delete;
+  ConcurrentGEA3& operator=(const ConcurrentGEA3&) = delete;
+
+  // May only be called once. The UART must not be used by any other thread
+  // after this is called.
+  void begin(
+    Stream& uart,
+    uint8_t clientAddress = 0xE4,
+    uint32_t requestTimeout = 250,
+    uint8_t requestRetries = 10,
+    uint32_t idleInterval = 1)
+  {
+    std::lock_guard<std::mutex> lock(lifecycleMutex);
+
+    bool alreadyStarted = started.exchange(true);
+    assert(!alreadyStarted);
+    if(alreadyStarted) {
+      return;
+    }
+
+    host->running.store(true);
+
+    auto host = this->host;
+    Stream* uartPointer = &uart;
+    thread = std::thread([host, uartPointer, clientAddress, requestTimeout, requestRetries, idleInterval]() {
+      host->ioThread.store(std::this_thread::get_id());
+      host->gea3.begin(*uartPointer, clientAddress, requestTimeout, requestRetries);
+      host->run(idleInterval);
+    });
+  }
+
+  void end()
+  {
+    // The I/O thread cannot join itself, and another thread may be holding the
+    // lock while it waits for this callback to return
+    if(std::this_thread::get_id() == host->ioThread.load()) {
+      host->running.store(false);
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(lifecycleMutex);
+
+    started.store(true);
+    host->running.store(false);
+
+    if(thread.joinable()) {
+      thread.join();
+    }
+
+    host->finish();
+  }
+
+  // Runs an arbitrary command on the I/O thread. Returns false if the command
+  // was dropped because end() has been called.
+  bool post(std::function<void(GEA3& gea3)> command)
+  {
+    return host->post([command](GEA3& gea3) {
+      command(gea3);
+      return true;
+    });
+  }
+
+  void sendPacket(GEA3::Packet packet)
+  {
+    auto shared = std::make_shared<GEA3::Packet>(std::move(packet));
+    post([shared](GEA3& gea3) {
+      gea3.sendPacket(*shared);
+    });
+  }
+
+  PacketListener onPacketReceived(std::function<void(const GEA3::Packet& packet)> callback)
+  {
+    auto listener = std::make_shared<PrivatePacketListener>(host->nextId++, std::move(callback));
+    auto rawHost = host.get();
+
+    post([rawHost, listener](GEA3& gea3) {
+      listener->listener = gea3.onPacketReceived(
+        listener.get(), +[](PrivatePacketListener* listener, const GEA3::Packet& packet) {
+          listener->callback(packet);
+        });
+      rawHost->registrations.push_back(listener);
+    });
+
+    return PacketListener(host, listener->id);
+  }
+
+  template <typename T>
+  std::future<GEA3::ReadResult<T>> readERD(uint16_t erd)
+  {
+    return readERD<T>(GEA3::defaultAddress, erd);
+  }
+
+  template <typename T>
+  std::future<GEA3::ReadResult<T>> readERD(uint8_t address, uint16_t erd)
+  {
+    auto promise = std::make_shared<std::promise<GEA3::ReadResult<T>>>();
+    auto future = promise->get_future();
+    auto rawHost = host.get();
+
+    host->post([rawHost, promise, address, erd](GEA3& gea3) {
+      auto request = rawHost->track(promise);
+
+      bool accepted = gea3.readERDAsync(
+        address, erd, request, +[](void* context, GEA3::ReadStatus status, const void* value_, uint8_t valueSize) {
+          auto request = reinterpret_cast<PrivatePromise<GEA3::ReadResult<T>>*>(context);
+          T value{};
+          if(value_ != nullptr) {
+            memcpy(&value, value_, std::min(static_cast<size_t>(valueSize), sizeof(T)));
+          }
+          request->promise->set_value(GEA3::ReadResult<T>{ status, value });
+          request->host->complete(request);
+        });
+
+      if(!accepted) {
+        rawHost->complete(request);
+
+        // Retry once an outstanding request has made room in the ERD client;
+        // if nothing is outstanding, there is no room to wait for
+        if(!rawHost->requests.empty()) {
+          return false;
+        }
+        promise->set_value(GEA3::ReadResult<T>{ GEA3::ReadStatus::retriesExhausted, T{} });
+      }
+
+      return true;
+    });
+
+    return future;
+  }
+
+  template <typename T>
+  std::future<GEA3::WriteStatus> writeERD(uint16_t erd, T value)
+  {
+    return writeERD(GEA3::defaultAddress, erd, value);
+  }
+
+  template <typename T>
+  std::future<GEA3::WriteStatus> writeERD(uint8_t address, uint16_t erd, T value)
+  {
+    return writeERD(address, erd, &value, sizeof(value));
+  }
+
+  std::future<GEA3::WriteStatus> writeERD(uint8_t address, uint16_t erd, const void* value, size_t valueSize)
+  {
+    auto promise = std::make_shared<std::promise<GEA3::WriteStatus>>();
+    auto future = promise->get_future();
+    auto rawHost = host.get();
+
+    auto bytes = reinterpret_cast<const uint8_t*>(value);
+    auto data = std::make_shared<std::vector<uint8_t>>(bytes, bytes + valueSize);
+
+    host->post([rawHost, promise, address, erd, data](GEA3& gea3) {
+      auto request = rawHost->track(promise);
+
+      bool accepted = gea3.writeERDAsync(
+        address, erd, data->data(), data->size(), request, +[](void* context, GEA3::WriteStatus status) {
+          auto request = reinterpret_cast<PrivatePromise<GEA3::WriteStatus>*>(context);
+          request->promise->set_value(status);
+          request->host->complete(request);
+        });
+
+      if(!accepted) {
+        rawHost->complete(request);
+
+        if(!rawHost->requests.empty()) {
+          return false;
+        }
+        promise->set_value(GEA3::WriteStatus::retriesExhausted);
+      }
+
+      return true;
+    });
+
+    return future;
+  }
+
+  ErdSubscription subscribe(std::function<void(uint16_t erd, const void* value, uint8_t valueSize)> callback)
+  {
+    return subscribe(GEA3::defaultAddress, std::move(callback));
+  }
+
+  ErdSubscription subscribe(uint8_t address, std::function<void(uint16_t erd, const void* value, uint8_t valueSize)> callback)
+  {
+    auto subscription = std::make_shared<PrivateErdSubscription>(host->nextId++, std::move(callback));
+    auto rawHost = host.get();
+
+    post([rawHost, subscription, address](GEA3& gea3) {
+      subscription->subscription = gea3.subscribe(
+        address, subscription.get(), +[](void* context, uint16_t erd, const void* value, uint8_t valueSize) {
+          reinterpret_cast<PrivateErdSubscription*>(context)->callback(erd, value, valueSize);
+        });
+      rawHost->registrations.push_back(subscription);
+    });
+
+    return ErdSubscription(host, subscription->id);
+  }
+
+ private:
+  std::shared_ptr<PrivateHost> host;
+  std::mutex lifecycleMutex;
+  std::atomic<bool> started;
+  std::thread thread;
+};
+
+#endif
@@ -298,7 +298,8 @@ class GEA3 {
       });
   }
 
-  void readERDAsync(uint8_t address, uint16_t erd, void* context, void (*callback)(void* context, ReadStatus status, const void* value, uint8_t valueSize));
+  // Returns false without invoking the callback if the ERD client cannot queue the request
+  bool readERDAsync(uint8_t address, uint16_t erd, void* context, void (*callback)(void* context, ReadStatus status, const void* value, uint8_t valueSize));
 
   template <typename T>
   ReadResult<T> readERD(uint16_t erd)
@@ -356,7 +357,8 @@ class GEA3 {
     writeERDAsync(address, erd, &value, sizeof(value), reinterpret_cast<void*>(context), reinterpret_cast<void (*)(void*, WriteStatus)>(callback));
   }
 
-  void writeERDAsync(uint8_t address, uint16_t erd, const void* value, size_t valueSize, void* context, void (*callback)(void* context, WriteStatus status));
+  // Returns false without invoking the callback if the ERD client cannot queue the request
+  bool writeERDAsync(uint8_t address, uint16_t erd, const void* value, size_t valueSize, void* context, void (*callback)(void* context, WriteStatus status));
 
   template <typename T>
   WriteStatus writeERD(uint16_t erd, T value)
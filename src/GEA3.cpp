@@ -116,10 +116,12 @@ GEA3::PacketListener GEA3::onPacketReceived(void (*callback)(const GEA3::Packet&
     });
 }
 
-void GEA3::readERDAsync(uint8_t address, uint16_t erd, void* context, void (*callback)(void* context, ReadStatus status, const void* value, uint8_t valueSize))
+bool GEA3::readERDAsync(uint8_t address, uint16_t erd, void* context, void (*callback)(void* context, ReadStatus status, const void* value, uint8_t valueSize))
 {
   tiny_gea3_erd_client_request_id_t requestId;
-  tiny_gea3_erd_client_read(&erdClient.interface, &requestId, address, erd);
+  if(!tiny_gea3_erd_client_read(&erdClient.interface, &requestId, address, erd)) {
+    return false;
+  }
 
   auto subscription = new AsyncReadSubscription{ context, callback, requestId, &erdClient };
 
@@ -150,12 +152,16 @@ void GEA3::readERDAsync(uint8_t address, uint16_t erd, void* context, void (*cal
       }
     });
   tiny_event_subscribe(tiny_gea3_erd_client_on_activity(&erdClient.interface), &subscription->subscription);
+
+  return true;
 }
 
-void GEA3::writeERDAsync(uint8_t address, uint16_t erd, const void* value, size_t valueSize, void* context, void (*callback)(void* context, WriteStatus status))
+bool GEA3::writeERDAsync(uint8_t address, uint16_t erd, const void* value, size_t valueSize, void* context, void (*callback)(void* context, WriteStatus status))
 {
   tiny_gea3_erd_client_request_id_t requestId;
-  tiny_gea3_erd_client_write(&erdClient.interface, &requestId, address, erd, value, valueSize);
+  if(!tiny_gea3_erd_client_write(&erdClient.interface, &requestId, address, erd, value, valueSize)) {
+    return false;
+  }
 
   auto subscription = new AsyncWriteSubscription(context, callback, requestId, &erdClient);
 
@@ -190,6 +196,8 @@ void GEA3::writeERDAsync(uint8_t address, uint16_t erd, const void* value, size_
       }
     });
   tiny_event_subscribe(tiny_gea3_erd_client_on_activity(&erdClient.interface), &subscription->subscription);
+
+  return true;
 }
 
 GEA3::WriteStatus GEA3::writeERD(uint8_t address, uint16_t erd, const void* value, size_t valueSize)